@@ -4,6 +4,7 @@
 #include <ctype.h>
 #include <errno.h>
 #include <stdio.h>
+#include <math.h>
 #include "compat-5.3.h"
 
 /* don't compile it again if it already is included via compat53.h */
@@ -51,6 +52,11 @@
 #  define COMPAT53_LUA_FILE_BUFFER_SIZE 4096
 #endif /* Lua File Buffer Size */
 
+#ifndef COMPAT53_ROTATE_SHIFTS
+/* lua_rotate uses single-step lua_insert/lua_remove up to this shift */
+#  define COMPAT53_ROTATE_SHIFTS 4
+#endif /* lua_rotate shifts */
+
 
 static char* compat53_strerror (int en, char* buff, size_t sz) {
 #if COMPAT53_HAVE_STRERROR_R
@@ -109,27 +115,47 @@ static void compat53_call_lua (lua_State *L, char const code[], size_t len,
 }
 
 
-static const char compat53_arith_code[] =
-  "local op,a,b=...\n"
-  "if op==0 then return a+b\n"
-  "elseif op==1 then return a-b\n"
-  "elseif op==2 then return a*b\n"
-  "elseif op==3 then return a/b\n"
-  "elseif op==4 then return a%b\n"
-  "elseif op==5 then return a^b\n"
-  "elseif op==6 then return -a\n"
-  "end\n";
+/* one chunk per operator, so the slow path needs no dispatch in Lua */
+static const char *const compat53_arith_code[] = {
+  "local a,b=...\nreturn a+b\n",
+  "local a,b=...\nreturn a-b\n",
+  "local a,b=...\nreturn a*b\n",
+  "local a,b=...\nreturn a/b\n",
+  "local a,b=...\nreturn a%b\n",
+  "local a,b=...\nreturn a^b\n",
+  "local a=...\nreturn -a\n"
+};
+
+
+static lua_Number compat53_numarith (int op, lua_Number a, lua_Number b) {
+  switch (op) {
+    case LUA_OPADD: return a+b;
+    case LUA_OPSUB: return a-b;
+    case LUA_OPMUL: return a*b;
+    case LUA_OPDIV: return a/b;
+    case LUA_OPMOD: return a - floor(a/b)*b;
+    case LUA_OPPOW: return pow(a, b);
+    default: return -a; /* LUA_OPUNM */
+  }
+}
 
 COMPAT53_API void lua_arith (lua_State *L, int op) {
   if (op < LUA_OPADD || op > LUA_OPUNM)
     luaL_error(L, "invalid 'op' argument for lua_arith");
-  luaL_checkstack(L, 5, "not enough stack slots");
-  if (op == LUA_OPUNM)
-    lua_pushvalue(L, -1);
-  lua_pushnumber(L, op);
-  lua_insert(L, -3);
-  compat53_call_lua(L, compat53_arith_code,
-                    sizeof(compat53_arith_code)-1, 3, 1);
+  if (lua_type(L, -1) == LUA_TNUMBER &&
+      (op == LUA_OPUNM || lua_type(L, -2) == LUA_TNUMBER)) {
+    /* plain numbers: no coercions or metamethods involved */
+    int nargs = (op == LUA_OPUNM) ? 1 : 2;
+    lua_Number a = lua_tonumber(L, -nargs);
+    lua_Number b = lua_tonumber(L, -1);
+    lua_pop(L, nargs);
+    lua_pushnumber(L, compat53_numarith(op, a, b));
+    return;
+  }
+  luaL_checkstack(L, 3, "not enough stack slots");
+  compat53_call_lua(L, compat53_arith_code[op],
+                    strlen(compat53_arith_code[op]),
+                    (op == LUA_OPUNM) ? 1 : 2, 1);
 }
 
 
@@ -145,6 +171,14 @@ COMPAT53_API int lua_compare (lua_State *L, int idx1, int idx2, int op) {
     case LUA_OPLT:
       return lua_lessthan(L, idx1, idx2);
     case LUA_OPLE:
+      if (lua_type(L, idx1) == LUA_TNUMBER &&
+          lua_type(L, idx2) == LUA_TNUMBER)
+        return lua_tonumber(L, idx1) <= lua_tonumber(L, idx2);
+      else if (lua_type(L, idx1) == LUA_TSTRING &&
+               lua_type(L, idx2) == LUA_TSTRING)
+        /* strings are totally ordered (no NaNs or metamethods), so
+         * the core's '<' gives the same result as its '<=' would */
+        return !lua_lessthan(L, idx2, idx1);
       luaL_checkstack(L, 5, "not enough stack slots");
       idx1 = lua_absindex(L, idx1);
       idx2 = lua_absindex(L, idx2);
@@ -664,25 +698,74 @@ COMPAT53_API void luaL_buffinit (lua_State *L, luaL_Buffer_53 *B) {
 }
 
 
-COMPAT53_API char *luaL_prepbuffsize (luaL_Buffer_53 *B, size_t s) {
+/* userdata holding a block from the allocator, so it can grow in place */
+typedef struct compat53_UBox {
+  void *box;
+  size_t bsize;
+} compat53_UBox;
+
+
+static void *compat53_resizebox (lua_State *L, int idx, size_t newsize) {
+  void *ud;
+  lua_Alloc allocf = lua_getallocf(L, &ud);
+  compat53_UBox *box = (compat53_UBox*)lua_touserdata(L, idx);
+  void *temp = allocf(ud, box->box, box->bsize, newsize);
+  if (temp == NULL && newsize > 0)
+    luaL_error(L, "not enough memory");
+  box->box = temp;
+  box->bsize = newsize;
+  return temp;
+}
+
+
+static int compat53_boxgc (lua_State *L) {
+  compat53_resizebox(L, 1, 0);
+  return 0;
+}
+
+
+static void compat53_newbox (lua_State *L) {
+  compat53_UBox *box = (compat53_UBox*)lua_newuserdata(L, sizeof(compat53_UBox));
+  box->box = NULL;
+  box->bsize = 0;
+  if (luaL_newmetatable(L, "__compat53_ubox")) {
+    lua_pushcfunction(L, compat53_boxgc);
+    lua_setfield(L, -2, "__gc");
+  }
+  lua_setmetatable(L, -2);
+}
+
+
+/* `boxidx' is where the box is if the buffer already has one; a new
+ * box is always pushed on top of the stack */
+static char *compat53_prepbuffsize (luaL_Buffer_53 *B, size_t s, int boxidx) {
   if (B->capacity - B->nelems < s) { /* needs to grow */
-    char* newptr = NULL;
     size_t newcap = B->capacity * 2;
-    if (newcap - B->nelems < s)
+    /* an empty buffer is sized exactly, e.g. from luaL_buffinitsize */
+    if (newcap - B->nelems < s || B->nelems == 0)
       newcap = B->nelems + s;
     if (newcap < B->capacity) /* overflow */
       luaL_error(B->L2, "buffer too large");
-    newptr = (char*)lua_newuserdata(B->L2, newcap);
-    memcpy(newptr, B->ptr, B->nelems);
-    if (B->ptr != B->b.buffer)
-      lua_replace(B->L2, -2); /* remove old buffer */
-    B->ptr = newptr;
+    if (B->ptr == B->b.buffer) { /* move contents into a new box */
+      char *newptr = NULL;
+      luaL_checkstack(B->L2, 3, "not enough stack slots available");
+      compat53_newbox(B->L2);
+      newptr = (char*)compat53_resizebox(B->L2, -1, newcap);
+      memcpy(newptr, B->ptr, B->nelems);
+      B->ptr = newptr;
+    } else /* grow the existing box (in place if possible) */
+      B->ptr = (char*)compat53_resizebox(B->L2, boxidx, newcap);
     B->capacity = newcap;
   }
   return B->ptr+B->nelems;
 }
 
 
+COMPAT53_API char *luaL_prepbuffsize (luaL_Buffer_53 *B, size_t s) {
+  return compat53_prepbuffsize(B, s, -1);
+}
+
+
 COMPAT53_API void luaL_addlstring (luaL_Buffer_53 *B, const char *s, size_t l) {
   memcpy(luaL_prepbuffsize(B, l), s, l);
   luaL_addsize(B, l);
@@ -691,20 +774,26 @@ COMPAT53_API void luaL_addlstring (luaL_Buffer_53 *B, const char *s, size_t l) {
 
 COMPAT53_API void luaL_addvalue (luaL_Buffer_53 *B) {
   size_t len = 0;
+  int hadbox = B->ptr != B->b.buffer;
   const char *s = lua_tolstring(B->L2, -1, &len);
   if (!s)
     luaL_error(B->L2, "cannot convert value to string");
-  if (B->ptr != B->b.buffer)
-    lua_insert(B->L2, -2); /* userdata buffer must be at stack top */
-  luaL_addlstring(B, s, len);
-  lua_remove(B->L2, B->ptr != B->b.buffer ? -2 : -1);
+  /* the value stays on top of the box while it is copied */
+  memcpy(compat53_prepbuffsize(B, len, -2), s, len);
+  luaL_addsize(B, len);
+  if (!hadbox && B->ptr != B->b.buffer)
+    lua_remove(B->L2, -2); /* new box was pushed above the value */
+  else
+    lua_pop(B->L2, 1);
 }
 
 
 void luaL_pushresult (luaL_Buffer_53 *B) {
   lua_pushlstring(B->L2, B->ptr, B->nelems);
-  if (B->ptr != B->b.buffer)
-    lua_replace(B->L2, -2); /* remove userdata buffer */
+  if (B->ptr != B->b.buffer) {
+    compat53_resizebox(B->L2, -2, 0); /* don't wait for the collector */
+    lua_remove(B->L2, -2); /* remove userdata buffer */
+  }
 }
 
 
@@ -724,8 +813,22 @@ COMPAT53_API const char *lua_pushlstring (lua_State *L, const char *s, size_t le
 }
 
 
+/* plain tables (no metatable) can be indexed with lua_raw[gs]eti */
+static int compat53_rawindexable (lua_State *L, int index, lua_Integer i) {
+  if (lua_type(L, index) != LUA_TTABLE || (lua_Integer)(int)i != i)
+    return 0;
+  if (lua_getmetatable(L, index)) {
+    lua_pop(L, 1);
+    return 0;
+  }
+  return 1;
+}
+
+
 COMPAT53_API int lua_geti (lua_State *L, int index, lua_Integer i) {
   index = lua_absindex(L, index);
+  if (compat53_rawindexable(L, index, i))
+    return lua_rawgeti(L, index, (int)i);
   lua_pushinteger(L, i);
   lua_gettable(L, index);
   return lua_type(L, -1);
@@ -736,25 +839,28 @@ COMPAT53_API int lua_geti (lua_State *L, int index, lua_Integer i) {
 #define LUA_EXTRASPACE (sizeof(void*))
 #endif
 
+/* The extra space lives in the registry under a fixed string key, so
+ * that separately compiled copies of this file share it. There is no
+ * C-side shortcut for the main thread: a static pointer would be shared
+ * by all lua_States of the process (and by OS threads running them),
+ * and could outlive the state it was taken from. */
 COMPAT53_API void *lua_getextraspace (lua_State *L) {
   int is_main = 0;
   void *ptr = NULL;
   luaL_checkstack(L, 4, "not enough stack slots available");
   lua_pushliteral(L, "__compat53_extraspace");
-  lua_pushvalue(L, -1);
   lua_rawget(L, LUA_REGISTRYINDEX);
-  if (!lua_istable(L, -1)) {
+  if (!lua_istable(L, -1)) {  /* first call for this state */
     lua_pop(L, 1);
     lua_createtable(L, 0, 2);
     lua_createtable(L, 0, 1);
     lua_pushliteral(L, "k");
     lua_setfield(L, -2, "__mode");
     lua_setmetatable(L, -2);
-    lua_pushvalue(L, -2);
+    lua_pushliteral(L, "__compat53_extraspace");
     lua_pushvalue(L, -2);
     lua_rawset(L, LUA_REGISTRYINDEX);
   }
-  lua_replace(L, -2);
   is_main = lua_pushthread(L);
   lua_rawget(L, -2);
   ptr = lua_touserdata(L, -1);
@@ -816,28 +922,42 @@ COMPAT53_API lua_Integer lua_tointegerx (lua_State *L, int i, int *isnum) {
 }
 
 
-static void compat53_reverse (lua_State *L, int a, int b) {
-  for (; a < b; ++a, --b) {
-    lua_pushvalue(L, a);
-    lua_pushvalue(L, b);
-    lua_replace(L, a);
-    lua_replace(L, b);
-  }
-}
-
-
 COMPAT53_API void lua_rotate (lua_State *L, int idx, int n) {
   int n_elems = 0;
   idx = lua_absindex(L, idx);
   n_elems = lua_gettop(L)-idx+1;
   if (n < 0)
     n += n_elems;
-  if ( n > 0 && n < n_elems) {
-    luaL_checkstack(L, 2, "not enough stack slots available");
-    n = n_elems - n;
-    compat53_reverse(L, idx, idx+n-1);
-    compat53_reverse(L, idx+n, idx+n_elems-1);
-    compat53_reverse(L, idx, idx+n_elems-1);
+  if (n <= 0 || n >= n_elems)
+    return;
+  luaL_checkstack(L, 2, "not enough stack slots available");
+  if (n <= COMPAT53_ROTATE_SHIFTS) {
+    for (; n > 0; --n)
+      lua_insert(L, idx);
+  } else if (n_elems - n <= COMPAT53_ROTATE_SHIFTS) {
+    for (n = n_elems - n; n > 0; --n) {
+      lua_pushvalue(L, idx);
+      lua_remove(L, idx);
+    }
+  } else {
+    /* cycle leader: every element is moved exactly once */
+    int a = n_elems, b = n, cycles, i;
+    while (b != 0) {
+      int t = a % b;
+      a = b;
+      b = t;
+    }
+    for (cycles = a, i = 0; i < cycles; ++i) {
+      int dst = i, src = i - n + n_elems;
+      lua_pushvalue(L, idx+i);
+      while (src != i) {
+        lua_pushvalue(L, idx+src);
+        lua_replace(L, idx+dst);
+        dst = src;
+        src = (src >= n) ? src - n : src - n + n_elems;
+      }
+      lua_replace(L, idx+dst);
+    }
   }
 }
 
@@ -845,6 +965,10 @@ COMPAT53_API void lua_rotate (lua_State *L, int idx, int n) {
 COMPAT53_API void lua_seti (lua_State *L, int index, lua_Integer i) {
   luaL_checkstack(L, 1, "not enough stack slots available");
   index = lua_absindex(L, index);
+  if (compat53_rawindexable(L, index, i)) {
+    lua_rawseti(L, index, (int)i);
+    return;
+  }
   lua_pushinteger(L, i);
   lua_insert(L, -2);
   lua_settable(L, index);
@@ -855,18 +979,57 @@ COMPAT53_API void lua_seti (lua_State *L, int index, lua_Integer i) {
 #  define lua_str2number(s, p)  strtod((s), (p))
 #endif
 
-COMPAT53_API size_t lua_stringtonumber (lua_State *L, const char *s) {
-  char* endptr;
-  lua_Number n = lua_str2number(s, &endptr);
-  if (endptr != s) {
-    while (*endptr != '\0' && isspace((unsigned char)*endptr))
-      ++endptr;
-    if (*endptr == '\0') {
-      lua_pushnumber(L, n);
-      return endptr - s + 1;
-    }
+/* integers that lua_Number holds exactly (at most 15 decimal or 13
+ * hexadecimal digits) are converted without going through strtod */
+static const char *compat53_str2int (const char *s, lua_Number *result) {
+  lua_Number a = 0;
+  int neg = 0, n = 0;
+  while (isspace((unsigned char)*s))
+    s++;
+  if (*s == '-') {
+    s++;
+    neg = 1;
+  } else if (*s == '+')
+    s++;
+  if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+    for (s += 2; isxdigit((unsigned char)*s) && n < 13; s++, n++)
+      a = a * 16 + (isdigit((unsigned char)*s) ? *s - '0' :
+                    tolower((unsigned char)*s) - 'a' + 10);
+  } else {
+    for (; isdigit((unsigned char)*s) && n < 15; s++, n++)
+      a = a * 10 + (*s - '0');
   }
-  return 0;
+  while (isspace((unsigned char)*s))
+    s++;
+  if (n == 0 || *s != '\0') /* not an integer, or too many digits */
+    return NULL;
+  *result = neg ? 0 - a : a; /* "-0" is integer zero, not -0.0 */
+  return s;
+}
+
+
+static const char *compat53_str2d (const char *s, lua_Number *result) {
+  char *endptr;
+  if (strpbrk(s, "nN")) /* reject 'inf' and 'nan' */
+    return NULL;
+  *result = lua_str2number(s, &endptr);
+  if (endptr == s) /* nothing recognized? */
+    return NULL;
+  while (isspace((unsigned char)*endptr))
+    endptr++;
+  return (*endptr == '\0') ? endptr : NULL;
+}
+
+
+COMPAT53_API size_t lua_stringtonumber (lua_State *L, const char *s) {
+  lua_Number n = 0;
+  const char *e = compat53_str2int(s, &n);
+  if (e == NULL)
+    e = compat53_str2d(s, &n);
+  if (e == NULL)
+    return 0;
+  lua_pushnumber(L, n);
+  return (e - s) + 1;
 }
 
 
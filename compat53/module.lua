@@ -714,24 +714,32 @@ if lua_version < "5.3" then
       end
 
 
-      local function fix_pattern(pattern)
-         return (string_gsub(pattern, "%z", "%%z"))
-      end
+      -- the Lua 5.3 matcher from compat53.string (already copied to
+      -- M.string) handles embedded zeros itself; it is not built for
+      -- LuaJIT, whose builtin functions are better for the JIT compiler
+      if not (str_ok and strlib.find) then
+         local function fix_pattern(pattern)
+            if string_find(pattern, "\0", 1, true) then
+               return (string_gsub(pattern, "%z", "%%z"))
+            end
+            return pattern
+         end
 
-      function M.string.find(s, pattern, ...)
-         return string_find(s, fix_pattern(pattern), ...)
-      end
+         function M.string.find(s, pattern, ...)
+            return string_find(s, fix_pattern(pattern), ...)
+         end
 
-      function M.string.gmatch(s, pattern)
-         return string_gmatch(s, fix_pattern(pattern))
-      end
+         function M.string.gmatch(s, pattern)
+            return string_gmatch(s, fix_pattern(pattern))
+         end
 
-      function M.string.gsub(s, pattern, ...)
-         return string_gsub(s, fix_pattern(pattern), ...)
-      end
+         function M.string.gsub(s, pattern, ...)
+            return string_gsub(s, fix_pattern(pattern), ...)
+         end
 
-      function M.string.match(s, pattern, ...)
-         return string_match(s, fix_pattern(pattern), ...)
+         function M.string.match(s, pattern, ...)
+            return string_match(s, fix_pattern(pattern), ...)
+         end
       end
 
       if not is_luajit then
@@ -90,7 +90,8 @@ static const char *compat53_utf8_escape (lua_State* L, long x) {
 #include <locale.h>
 #include <lualib.h>
 /* move the string library open function out of the way (we only take
- * the string packing functions)!
+ * the string packing functions, and the pattern matching functions
+ * for PUC-Rio Lua 5.1)!
  */
 #  define luaopen_string luaopen_string_XXX
 /* used in string.format implementation, which we don't use: */
@@ -145,11 +146,24 @@ static const char *compat53_utf8_escape (lua_State* L, long x) {
 static int str_pack (lua_State *L);
 static int str_packsize (lua_State *L);
 static int str_unpack (lua_State *L);
+#  if LUA_VERSION_NUM == 501 && !defined(LUA_JITLIBNAME)
+/* the Lua 5.1 matcher doesn't handle embedded zeros in patterns */
+static int str_find (lua_State *L);
+static int str_match (lua_State *L);
+static int gmatch (lua_State *L);
+static int str_gsub (lua_State *L);
+#  endif
 LUAMOD_API int luaopen_compat53_string (lua_State *L) {
   luaL_Reg const funcs[] = {
     { "pack", str_pack },
     { "packsize", str_packsize },
     { "unpack", str_unpack },
+#  if LUA_VERSION_NUM == 501 && !defined(LUA_JITLIBNAME)
+    { "find", str_find },
+    { "match", str_match },
+    { "gmatch", gmatch },
+    { "gsub", str_gsub },
+#  endif
     { NULL, NULL }
   };
   luaL_newlib(L, funcs);
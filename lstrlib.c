@@ -211,6 +211,28 @@ static int str_dump (lua_State *L) {
 #define CAP_POSITION	(-2)
 
 
+/*
+** maximum number of character classes of a pattern that are compiled
+** into bit sets during one match
+*/
+#if !defined(MAXCLASSSETS)
+#define MAXCLASSSETS	8
+#endif
+
+/*
+** number of bytes a class must have been tested against in one match
+** state before it is compiled into a bit set (compiling one tests every
+** possible byte once, so short or anchored matches never pay for it)
+*/
+#if !defined(MINSETUSES)
+#define MINSETUSES	256
+#endif
+
+#define CLASSSETSIZE	((UCHAR_MAX / CHAR_BIT) + 1)
+
+#define inset(set,c)	((set)[uchar(c) / CHAR_BIT] & (1u << (uchar(c) % CHAR_BIT)))
+
+
 typedef struct MatchState {
   const char *src_init;  /* init of source string */
   const char *src_end;  /* end ('\0') of source string */
@@ -218,10 +240,16 @@ typedef struct MatchState {
   lua_State *L;
   int matchdepth;  /* control for recursive depth (to avoid C stack overflow) */
   unsigned char level;  /* total number of captures (finished or unfinished) */
+  int nsets;  /* number of classes in 'classset' */
   struct {
     const char *init;
     ptrdiff_t len;
   } capture[LUA_MAXCAPTURES];
+  struct {
+    const char *p;  /* class in the pattern */
+    int uses;  /* bytes tested against it (-1 once 'set' is compiled) */
+    unsigned char set[CLASSSETSIZE];  /* characters matched by it */
+  } classset[MAXCLASSSETS];
 } MatchState;
 
 
@@ -322,6 +350,54 @@ static int matchbracketclass (int c, const char *p, const char *ec) {
 }
 
 
+/*
+** Count one test of a byte against the class at 'p' (a '%' class or a
+** bracket class ending just before 'ep') and return its bit set, which
+** is compiled once the class has been used MINSETUSES times; NULL until
+** then, or if no set can be used for this class.
+*/
+static const unsigned char *classset (MatchState *ms, const char *p,
+                                      const char *ep) {
+  int i, c;
+  unsigned char *set;
+  for (i = 0; i < ms->nsets && ms->classset[i].p != p; i++)
+    ;
+  if (i == ms->nsets) {  /* class not seen yet? */
+    if (i == MAXCLASSSETS)  /* no more sets? */
+      return NULL;
+    ms->classset[i].p = p;
+    ms->classset[i].uses = 0;
+    ms->nsets++;
+  }
+  set = ms->classset[i].set;
+  if (ms->classset[i].uses >= 0) {  /* not compiled yet? */
+    if (++ms->classset[i].uses < MINSETUSES)
+      return NULL;  /* not used often enough yet */
+    memset(set, 0, CLASSSETSIZE);
+    for (c = 0; c <= UCHAR_MAX; c++) {
+      if (*p == L_ESC ? match_class(c, uchar(*(p+1)))
+                      : matchbracketclass(c, p, ep-1))
+        set[c / CHAR_BIT] |= 1u << (c % CHAR_BIT);
+    }
+    ms->classset[i].uses = -1;
+  }
+  return set;
+}
+
+
+/* match 'c' against a '%' class or a bracket class */
+static int matchclass (MatchState *ms, int c, const char *p,
+                       const char *ep) {
+  const unsigned char *set = classset(ms, p, ep);
+  if (set)
+    return inset(set, c) != 0;
+  else if (*p == L_ESC)
+    return match_class(c, uchar(*(p+1)));
+  else
+    return matchbracketclass(c, p, ep-1);
+}
+
+
 static int singlematch (MatchState *ms, const char *s, const char *p,
                         const char *ep) {
   if (s >= ms->src_end)
@@ -330,8 +406,7 @@ static int singlematch (MatchState *ms, const char *s, const char *p,
     int c = uchar(*s);
     switch (*p) {
       case '.': return 1;  /* matches any char */
-      case L_ESC: return match_class(c, uchar(*(p+1)));
-      case '[': return matchbracketclass(c, p, ep-1);
+      case L_ESC: case '[': return matchclass(ms, c, p, ep);
       default:  return (uchar(*p) == c);
     }
   }
@@ -358,15 +433,44 @@ static const char *matchbalance (MatchState *ms, const char *s,
 }
 
 
+/*
+** Return the plain character that the pattern item at 'p' must match
+** (no class and no suffix that allows it to be skipped), or -1; used to
+** avoid recursing into 'match' at positions that cannot succeed.
+*/
+static int nextliteral (MatchState *ms, const char *p) {
+  if (p < ms->p_end && !strchr(SPECIALS ")", *p) &&
+      (p + 1 == ms->p_end || !strchr("*?-", *(p + 1))))
+    return uchar(*p);
+  else
+    return -1;
+}
+
+
 static const char *max_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
   ptrdiff_t i = 0;  /* counts maximum expand for item */
-  while (singlematch(ms, s + i, p, ep))
-    i++;
+  int next = nextliteral(ms, ep + 1);
+  const unsigned char *set;
+  if (*p == '.')  /* matches everything up to the end */
+    i = ms->src_end - s;
+  else {
+    while (singlematch(ms, s + i, p, ep)) {
+      i++;
+      if (i == MINSETUSES && (*p == L_ESC || *p == '[') &&
+          (set = classset(ms, p, ep)) != NULL) {  /* long repetition? */
+        while (s + i < ms->src_end && inset(set, s[i]))
+          i++;  /* scan the rest with the bit set */
+        break;
+      }
+    }
+  }
   /* keeps trying to match with the maximum repetitions */
   while (i>=0) {
-    const char *res = match(ms, (s+i), ep+1);
-    if (res) return res;
+    if (next < 0 || (s + i < ms->src_end && uchar(s[i]) == next)) {
+      const char *res = match(ms, (s+i), ep+1);
+      if (res) return res;
+    }
     i--;  /* else didn't match; reduce 1 repetition to try again */
   }
   return NULL;
@@ -375,8 +479,11 @@ static const char *max_expand (MatchState *ms, const char *s,
 
 static const char *min_expand (MatchState *ms, const char *s,
                                  const char *p, const char *ep) {
+  int next = nextliteral(ms, ep + 1);
   for (;;) {
-    const char *res = match(ms, s, ep+1);
+    const char *res = NULL;
+    if (next < 0 || (s < ms->src_end && uchar(*s) == next))
+      res = match(ms, s, ep+1);
     if (res != NULL)
       return res;
     else if (singlematch(ms, s, p, ep))
@@ -461,8 +568,8 @@ static const char *match (MatchState *ms, const char *s, const char *p) {
               luaL_error(ms->L, "missing '[' after '%%f' in pattern");
             ep = classend(ms, p);  /* points to what is next */
             previous = (s == ms->src_init) ? '\0' : *(s - 1);
-            if (!matchbracketclass(uchar(previous), p, ep - 1) &&
-               matchbracketclass(uchar(*s), p, ep - 1)) {
+            if (!matchclass(ms, uchar(previous), p, ep) &&
+               matchclass(ms, uchar(*s), p, ep)) {
               p = ep; goto init;  /* return match(ms, s, ep); */
             }
             s = NULL;  /* match failed */
@@ -535,7 +642,8 @@ static const char *lmemfind (const char *s1, size_t l1,
     l1 = l1-l2;  /* 's2' cannot be found after that */
     while (l1 > 0 && (init = (const char *)memchr(s1, *s2, l1)) != NULL) {
       init++;   /* 1st char is already checked */
-      if (memcmp(init, s2+1, l2) == 0)
+      if ((l2 == 0 || init[l2-1] == s2[l2]) &&  /* check last char first */
+          memcmp(init, s2+1, l2) == 0)
         return init-1;
       else {  /* correct 'l1' and 's1' to try again */
         l1 -= init-s1;
@@ -547,25 +655,40 @@ static const char *lmemfind (const char *s1, size_t l1,
 }
 
 
-static void push_onecapture (MatchState *ms, int i, const char *s,
-                                                    const char *e) {
+/*
+** get information about the i-th capture without pushing it: for a
+** position capture push its value and return CAP_POSITION, otherwise
+** return its length and put its start in '*cap'
+*/
+static ptrdiff_t get_onecapture (MatchState *ms, int i, const char *s,
+                                 const char *e, const char **cap) {
   if (i >= ms->level) {
-    if (i == 0)  /* ms->level == 0, too */
-      lua_pushlstring(ms->L, s, e - s);  /* add whole match */
-    else
+    if (i != 0)
       luaL_error(ms->L, "invalid capture index %%%d", i + 1);
+    *cap = s;  /* ms->level == 0, too: whole match */
+    return e - s;
   }
   else {
     ptrdiff_t l = ms->capture[i].len;
+    *cap = ms->capture[i].init;
     if (l == CAP_UNFINISHED) luaL_error(ms->L, "unfinished capture");
     if (l == CAP_POSITION)
       lua_pushinteger(ms->L, (ms->capture[i].init - ms->src_init) + 1);
-    else
-      lua_pushlstring(ms->L, ms->capture[i].init, l);
+    return l;
   }
 }
 
 
+static void push_onecapture (MatchState *ms, int i, const char *s,
+                                                    const char *e) {
+  const char *cap;
+  ptrdiff_t l = get_onecapture(ms, i, s, e, &cap);
+  if (l != CAP_POSITION)
+    lua_pushlstring(ms->L, cap, l);
+  /* else position was already pushed */
+}
+
+
 static int push_captures (MatchState *ms, const char *s, const char *e) {
   int i;
   int nlevels = (ms->level == 0 && s) ? 1 : ms->level;
@@ -588,6 +711,32 @@ static int nospecials (const char *p, size_t l) {
 }
 
 
+/*
+** Find a run of plain characters that every match of 'p' must start
+** with (leading captures do not consume anything), so that candidate
+** positions can be found with 'lmemfind'; return its length, or 0 if
+** there is no such run.
+*/
+static size_t literalprefix (MatchState *ms, const char *p,
+                             const char **lit) {
+  const char *q;
+  int ncap = 0;
+  while (p < ms->p_end && *p == '(' && ncap++ < LUA_MAXCAPTURES)
+    p += (p + 1 < ms->p_end && *(p + 1) == ')') ? 2 : 1;
+  if (p + 1 < ms->p_end && *p == L_ESC && !isalnum(uchar(*(p + 1)))) {
+    *lit = p + 1;  /* escaped character */
+    q = p + 2;
+    return (q < ms->p_end && strchr("*?-", *q)) ? 0 : 1;
+  }
+  for (q = p; q < ms->p_end && !strchr(SPECIALS ")", *q); q++)
+    ;  /* ('\0' counts as special here) */
+  if (q < ms->p_end && q > p && strchr("*?-", *q))
+    q--;  /* last character may match zero times */
+  *lit = p;
+  return q - p;
+}
+
+
 static void prepstate (MatchState *ms, lua_State *L,
                        const char *s, size_t ls, const char *p, size_t lp) {
   ms->L = L;
@@ -595,6 +744,7 @@ static void prepstate (MatchState *ms, lua_State *L,
   ms->src_init = s;
   ms->src_end = s + ls;
   ms->p_end = p + lp;
+  ms->nsets = 0;
 }
 
 
@@ -627,13 +777,20 @@ static int str_find_aux (lua_State *L, int find) {
   else {
     MatchState ms;
     const char *s1 = s + init - 1;
+    const char *lit = NULL;
+    size_t llen = 0;
     int anchor = (*p == '^');
     if (anchor) {
       p++; lp--;  /* skip anchor character */
     }
     prepstate(&ms, L, s, ls, p, lp);
+    if (!anchor)
+      llen = literalprefix(&ms, p, &lit);
     do {
       const char *res;
+      if (llen > 0 &&  /* skip to next position starting with 'lit' */
+          (s1 = lmemfind(s1, ms.src_end - s1, lit, llen)) == NULL)
+        break;
       reprepstate(&ms);
       if ((res=match(&ms, s1, p)) != NULL) {
         if (find) {
@@ -666,6 +823,8 @@ typedef struct GMatchState {
   const char *src;  /* current position */
   const char *p;  /* pattern */
   const char *lastmatch;  /* end of last match */
+  const char *lit;  /* literal prefix of all matches */
+  size_t llen;  /* length of 'lit' (0 if none) */
   MatchState ms;  /* match state */
 } GMatchState;
 
@@ -676,6 +835,9 @@ static int gmatch_aux (lua_State *L) {
   gm->ms.L = L;
   for (src = gm->src; src <= gm->ms.src_end; src++) {
     const char *e;
+    if (gm->llen > 0 &&
+        (src = lmemfind(src, gm->ms.src_end - src, gm->lit, gm->llen)) == NULL)
+      break;
     reprepstate(&gm->ms);
     if ((e = match(&gm->ms, src, gm->p)) != NULL && e != gm->lastmatch) {
       gm->src = gm->lastmatch = e;
@@ -695,6 +857,7 @@ static int gmatch (lua_State *L) {
   gm = (GMatchState *)lua_newuserdata(L, sizeof(GMatchState));
   prepstate(&gm->ms, L, s, ls, p, lp);
   gm->src = s; gm->p = p; gm->lastmatch = NULL;
+  gm->llen = literalprefix(&gm->ms, p, &gm->lit);
   lua_pushcclosure(L, gmatch_aux, 3);
   return 1;
 }
@@ -702,29 +865,32 @@ static int gmatch (lua_State *L) {
 
 static void add_s (MatchState *ms, luaL_Buffer *b, const char *s,
                                                    const char *e) {
-  size_t l, i;
+  size_t l;
   lua_State *L = ms->L;
   const char *news = lua_tolstring(L, 3, &l);
-  for (i = 0; i < l; i++) {
-    if (news[i] != L_ESC)
-      luaL_addchar(b, news[i]);
-    else {
-      i++;  /* skip ESC */
-      if (!isdigit(uchar(news[i]))) {
-        if (news[i] != L_ESC)
-          luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
-        luaL_addchar(b, news[i]);
-      }
-      else if (news[i] == '0')
-          luaL_addlstring(b, s, e - s);
-      else {
-        push_onecapture(ms, news[i] - '1', s, e);
-        luaL_tolstring(L, -1, NULL);  /* if number, convert it to string */
-        lua_remove(L, -2);  /* remove original value */
-        luaL_addvalue(b);  /* add capture to accumulated result */
-      }
+  const char *p;
+  while ((p = (const char *)memchr(news, L_ESC, l)) != NULL) {
+    luaL_addlstring(b, news, p - news);  /* add literal span */
+    p++;  /* skip ESC */
+    if (!isdigit(uchar(*p))) {
+      if (*p != L_ESC)
+        luaL_error(L, "invalid use of '%c' in replacement string", L_ESC);
+      luaL_addchar(b, *p);
     }
+    else if (*p == '0')
+        luaL_addlstring(b, s, e - s);
+    else {  /* copy the capture straight from the subject */
+      const char *cap;
+      ptrdiff_t resl = get_onecapture(ms, *p - '1', s, e, &cap);
+      if (resl == CAP_POSITION)
+        luaL_addvalue(b);  /* add position to accumulated result */
+      else
+        luaL_addlstring(b, cap, resl);
+    }
+    l -= p + 1 - news;
+    news = p + 1;
   }
+  luaL_addlstring(b, news, l);  /* add rest of the replacement */
 }
 
 
@@ -759,6 +925,34 @@ static void add_value (MatchState *ms, luaL_Buffer *b, const char *s,
 }
 
 
+/*
+** 'gsub' with a pattern without special characters and a replacement
+** string without escapes: find matches with 'lmemfind' and copy whole
+** blocks to the result
+*/
+static int plain_gsub (lua_State *L, const char *src, size_t srcl,
+                       const char *p, size_t lp,
+                       const char *r, size_t lr, lua_Integer max_s) {
+  const char *src_end = src + srcl;
+  lua_Integer n = 0;  /* replacement count */
+  luaL_Buffer b;
+  luaL_buffinit(L, &b);
+  while (n < max_s) {
+    const char *e = lmemfind(src, src_end - src, p, lp);
+    if (e == NULL)
+      break;
+    luaL_addlstring(&b, src, e - src);
+    luaL_addlstring(&b, r, lr);
+    src = e + lp;
+    n++;
+  }
+  luaL_addlstring(&b, src, src_end - src);
+  luaL_pushresult(&b);
+  lua_pushinteger(L, n);  /* number of substitutions */
+  return 2;
+}
+
+
 static int str_gsub (lua_State *L) {
   size_t srcl, lp;
   const char *src = luaL_checklstring(L, 1, &srcl);  /* subject */
@@ -768,18 +962,36 @@ static int str_gsub (lua_State *L) {
   lua_Integer max_s = luaL_optinteger(L, 4, srcl + 1);  /* max replacements */
   int anchor = (*p == '^');
   lua_Integer n = 0;  /* replacement count */
+  const char *lit = NULL;
+  size_t llen = 0;
   MatchState ms;
   luaL_Buffer b;
   luaL_argcheck(L, tr == LUA_TNUMBER || tr == LUA_TSTRING ||
                    tr == LUA_TFUNCTION || tr == LUA_TTABLE, 3,
                       "string/function/table expected");
+  if ((tr == LUA_TNUMBER || tr == LUA_TSTRING) && lp > 0 &&
+      nospecials(p, lp) && memchr(p, ')', lp) == NULL) {
+    size_t lr;
+    const char *r = lua_tolstring(L, 3, &lr);
+    if (memchr(r, L_ESC, lr) == NULL)  /* plain replacement? */
+      return plain_gsub(L, src, srcl, p, lp, r, lr, max_s);
+  }
   luaL_buffinit(L, &b);
   if (anchor) {
     p++; lp--;  /* skip anchor character */
   }
   prepstate(&ms, L, src, srcl, p, lp);
+  if (!anchor)
+    llen = literalprefix(&ms, p, &lit);
   while (n < max_s) {
     const char *e;
+    if (llen > 0) {  /* copy everything up to the next candidate */
+      const char *next = lmemfind(src, ms.src_end - src, lit, llen);
+      if (next == NULL)
+        break;
+      luaL_addlstring(&b, src, next - src);
+      src = next;
+    }
     reprepstate(&ms);  /* (re)prepare state for new match */
     if ((e = match(&ms, src, p)) != NULL && e != lastmatch) {  /* match? */
       n++;
@@ -1296,6 +1508,12 @@ static void packint (luaL_Buffer *b, lua_Unsigned n,
                      int islittle, int size, int neg) {
   char *buff = luaL_prepbuffsize(b, size);
   int i;
+  if (islittle == nativeendian.little && size <= SZINT) {  /* native? */
+    /* copy the low-order bytes of 'n' in one go */
+    memcpy(buff, (char *)&n + (islittle ? 0 : SZINT - size), size);
+    luaL_addsize(b, size);
+    return;
+  }
   buff[islittle ? 0 : size - 1] = (char)(n & MC);  /* first byte */
   for (i = 1; i < size; i++) {
     n >>= NB;
@@ -1313,12 +1531,10 @@ static void packint (luaL_Buffer *b, lua_Unsigned n,
 ** Copy 'size' bytes from 'src' to 'dest', correcting endianness if
 ** given 'islittle' is different from native endianness.
 */
-static void copywithendian (volatile char *dest, volatile const char *src,
+static void copywithendian (char *dest, const char *src,
                             int size, int islittle) {
-  if (islittle == nativeendian.little) {
-    while (size-- != 0)
-      *(dest++) = *(src++);
-  }
+  if (islittle == nativeendian.little)
+    memcpy(dest, src, size);
   else {
     dest += size - 1;
     while (size-- != 0)
@@ -1362,7 +1578,7 @@ static int str_pack (lua_State *L) {
         break;
       }
       case Kfloat: {  /* floating-point options */
-        volatile Ftypes u;
+        Ftypes u;
         char *buff = luaL_prepbuffsize(&b, size);
         lua_Number n = luaL_checknumber(L, arg);  /* get argument */
         if (size == sizeof(u.f)) u.f = (float)n;  /* copy it into 'u' */
@@ -1452,9 +1668,13 @@ static lua_Integer unpackint (lua_State *L, const char *str,
   lua_Unsigned res = 0;
   int i;
   int limit = (size  <= SZINT) ? size : SZINT;
-  for (i = limit - 1; i >= 0; i--) {
-    res <<= NB;
-    res |= (lua_Unsigned)(unsigned char)str[islittle ? i : size - 1 - i];
+  if (islittle == nativeendian.little && size <= SZINT)  /* native? */
+    memcpy((char *)&res + (islittle ? 0 : SZINT - size), str, size);
+  else {
+    for (i = limit - 1; i >= 0; i--) {
+      res <<= NB;
+      res |= (lua_Unsigned)(unsigned char)str[islittle ? i : size - 1 - i];
+    }
   }
   if (size < SZINT) {  /* real size smaller than lua_Integer? */
     if (issigned) {  /* needs sign extension? */
@@ -1500,7 +1720,7 @@ static int str_unpack (lua_State *L) {
         break;
       }
       case Kfloat: {
-        volatile Ftypes u;
+        Ftypes u;
         lua_Number num;
         copywithendian(u.buff, data + pos, size, h.islittle);
         if (size == sizeof(u.f)) num = (lua_Number)u.f;
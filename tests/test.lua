@@ -288,6 +288,29 @@ if string.pack then
   local format = "bBhHlLjJdc3z"
   local s = string.pack(format, -128, 255, -32768, 65535, -2147483648, 4294967295, -32768, 65536, 1.25, "abc", "defgh")
   print("string.unpack", string.unpack(format, s))
+  local function hex(s)
+    return (string.gsub(s, ".", function(c)
+      return string.format("%02x", string.byte(c))
+    end))
+  end
+  local native = string.pack("=I2", 1) == "\1\0" and "<" or ">"
+  print("string.pack", string.pack("<i4", 1) == "\1\0\0\0", string.pack(">i4", 1) == "\0\0\0\1")
+  print("string.pack", hex(string.pack(">i3", -2)), hex(string.pack("<i3", -2)))
+  print("string.pack", hex(string.pack("<I2", 0x1234)), hex(string.pack(">I2", 0x1234)))
+  print("string.pack", string.pack("=i2", 0x1234) == string.pack(native.."i2", 0x1234))
+  print("string.pack", hex(string.pack("<i16", -2)))
+  print("string.pack", hex(string.pack(">i16", -2)))
+  print("string.pack", hex(string.pack("<j", -300)), hex(string.pack(">J", 258)))
+  print("string.pack", hex(string.pack("<d", 1.5)), hex(string.pack(">f", -2)))
+  print("string.unpack", string.unpack("<i3", "\254\255\255"), string.unpack(">i3", "\255\255\254"))
+  print("string.unpack", string.unpack("<i3", "\1\0\128"), string.unpack(">I3", "\128\0\1"))
+  print("string.unpack", string.unpack("<i2", "\0\128"), string.unpack("<I2", "\0\128"))
+  local j = "\2\1\0\0\0\0\0\0"
+  print("string.unpack", string.unpack("<j", j), string.unpack(">j", j:reverse()))
+  print("string.unpack", string.unpack("=j", native == "<" and j or j:reverse()))
+  print("string.unpack", string.unpack("<i16", "\254" .. ("\255"):rep(15)))
+  print("string.unpack", string.unpack(">i16", ("\0"):rep(15) .. "\7"))
+  print("string.unpack", pcall(string.unpack, "<i16", ("\0"):rep(15) .. "\1"))
   ___''
 else
   print("XXX: string packing not available")
@@ -548,6 +571,160 @@ do
    print("string.gsub()", string.gsub("abc\0def\0ghi", "%A", "X"))
    print("string.match()", string.match("abc\0abc\0abc", "([^\0a]+)"))
    print("string.match()", #string.match("abc\0abc\0abc", ".*\0"))
+   print("string.find()", string.find("GET /api/x HTTP/1.1", "GET /api/([^ ]+)"))
+   print("string.find()", string.find("a.b.c", ".", 1, true))
+   print("string.gsub()", string.gsub("{{x}} and {{x}}", "{{x}}", "y"))
+   print("string.gsub()", string.gsub("{{x}} and {{x}}", "{{x}}", "y", 1))
+   print("string.gsub()", string.gsub("k1=v1, k2=v2", "(%w+)=(%w+)", "%2=%1 %%"))
+   print("string.gsub()", string.gsub("hello world", "()o", "%1"))
+   print("string.gsub()", #string.gsub(("ab-"):rep(1000), "[%w_]+", "%0%0"))
+   print("string.match()", string.match(("x"):rep(300) .. "=1;", "(%w+)=([^;]*);"))
+   do -- bracket classes on long subjects are matched via bit sets
+      local s = ("ab1 Cd2;ef3 "):rep(30)
+      local n, first, last, total = 0, nil, nil, 0
+      for w in string.gmatch(s, "[a-f]+[1-3]") do
+         n, total = n + 1, total + #w
+         first, last = first or w, w
+      end
+      print("string.gmatch()", #s, n, first, last, total)
+      n = 0
+      for k, v in string.gmatch(s, "([%a]+)([^%a%s;])") do
+         if k .. v == "ab1" or k .. v == "d2" or k .. v == "ef3" then n = n + 1 end
+      end
+      print("string.gmatch()", n)
+      local r, c = string.gsub(s, "[^%s;]+", "<%0>")
+      print("string.gsub()", c, #r, r:sub(1, 24))
+      r, c = string.gsub(s, "[%d;]", { ["1"] = "one", [";"] = "" })
+      print("string.gsub()", c, #r, r:sub(1, 24))
+      r, c = string.gsub(s, "[A-Z][a-z]", string.upper, 20)
+      print("string.gsub()", c, #r, r:sub(1, 24), r:sub(-24))
+      print("string.gsub()", string.gsub(s:sub(1, 12), "[^%s;]+", "<%0>"))
+      -- short anchored matches at offsets into a long subject
+      local src = ("local x_1 = y2+_z;\n"):rep(40)
+      local pos, t = 1, {}
+      while pos <= #src do
+         local b, e = string.find(src, "^[%a_][%w_]*", pos)
+         if b then t[#t+1], pos = src:sub(b, e), e + 1 else pos = pos + 1 end
+      end
+      print("string.find()", #src, #t, t[1], t[2], t[3], t[4], t[#t])
+      print("string.find()", string.find(src, "^[%a_][%w_]*", 7))
+      print("string.find()", string.find(src, "^[%a_][%w_]*", 12))
+      print("string.match()", string.match(src, "^[%d]", 10))
+   end
+   do -- %-classes: bit sets (long subject) vs. per-character checks
+      local all = {}
+      for i = 0, 255 do all[#all+1] = string.char(i) end
+      all = table.concat(all)
+      for c in ("acdglpsuwxACDGLPSUWX"):gmatch(".") do
+         local n, m = 0, select(2, string.gsub(all .. all, "%"..c, ""))
+         for i = 1, #all do
+            if string.find(all, "^%"..c, i) then n = n + 1 end
+         end
+         local r = #(string.match(all, "%"..c.."+") or "")
+         print("string.gsub()", "%"..c, m, 2*n == m, r)
+      end
+      for _, n in ipairs{ 255, 256, 257, 600 } do
+         print("string.match()", n, #string.match(("a1_"):rep(n) .. "-x", "[%w_]+"),
+               select(2, string.find(("a"):rep(n) .. "b", "^%l+b")),
+               select(2, string.find(("a"):rep(n) .. "b", "^%l+a")))
+      end
+      local s = ("THE (quick) fox-trot.  "):rep(30)
+      local n = 0
+      for w in string.gmatch(s, "%f[%a]%a+") do n = n + 1 end
+      print("string.gmatch()", #s, n)
+      print("string.gsub()", select(2, string.gsub(s, "%f[%w]%w+%f[%W]", "")))
+      print("string.gsub()", select(2, string.gsub(s, "%f[%l][a-z]", "")))
+      print("string.find()", string.find(s, "%f[%p]%p+%f[%s]"))
+      -- more classes than there are bit sets
+      s = ("abcdefghij0123456789;"):rep(30)
+      print("string.gsub()", string.gsub(s, "[a][b]%l[d][e]%a[g][h][i][j]%d", "X"))
+      print("string.gsub()", #s, select(2, string.gsub(s, "[a-c]+[d][e]+%l[g][h-i]*[j]%d[1]%d+[^%w]", "")))
+      print("string.find()", string.find(s, "[i][j][0][1][2][3][4][5][6][7][8][9];", 100))
+   end
+   do -- patterns starting with literal characters
+      local s = ("x key1=ab keyed key22=c; "):rep(20)
+      local n, t = 0, {}
+      for k, v in string.gmatch(s, "key(%d+)=(%a+)") do
+         n = n + 1
+         if n <= 2 then t[#t+1] = k .. ":" .. v end
+      end
+      print("string.gmatch()", n, t[1], t[2])
+      n = 0
+      for p in string.gmatch(s, "()key") do n = n + p end
+      print("string.gmatch()", n)
+      for w in string.gmatch("abbb a ab cab", "ab*") do
+         print("string.gmatch()", w)
+      end
+      print("string.gsub()", string.gsub("a.b.c$1 $22 $", "%$(%d+)", "<%1>"))
+      print("string.find()", string.find("x+y+z", "%+z"))
+      print("string.match()", string.match("a..x", "%.*x"))
+      print("string.match()", string.match("50%% off", "%d+%%-"))
+      print("string.find()", string.find(("x"):rep(300) .. "acabbbc", "ab*c"))
+      print("string.find()", string.find("ac", "ab?c"))
+      print("string.find()", string.find("xabd", "abc-d"))
+      print("string.find()", string.find("aab", "ab+"))
+      print("string.find()", string.find("ab\0c ab\0d", "ab\0d"))
+      print("string.gsub()", string.gsub("key1 key2 key", "^key%d", "X"))
+      print("string.gsub()", string.gsub("keykey1", "(key)(%d)", "%2%1"))
+      local r, c = string.gsub(s, "key(%d)", "[%1]", 3)
+      print("string.gsub()", c, #r, r:sub(1, 40))
+      print("string.gsub()", r:sub(-400) == s:sub(-400))
+      print("string.gsub()", string.gsub("a key1 b", "key%d", "X", 0))
+   end
+   do -- repetitions followed by a literal character
+      local s = ("a"):rep(300) .. "b"
+      print("string.find()", string.find(s, "a-b"))
+      print("string.find()", string.find(s, "^a-b"))
+      print("string.find()", string.find(s .. "bbc", "a-b+c"))
+      print("string.find()", string.find(s .. "bbc", "^.-b+"))
+      print("string.find()", string.find(s, "a-b*$"))
+      print("string.find()", string.find(s, "a-c"))
+      print("string.find()", string.find(s, "%a-"))
+      print("string.match()", string.match("k=v;k2=v2;", "(.-)=(.-);"))
+      print("string.match()", string.match("x==y", "(%w+)=+(%w+)"))
+      print("string.match()", #string.match(s .. "=;", "%a*=?;"))
+   end
+   do -- plain patterns with plain replacements
+      print("string.gsub()", string.gsub("aaa", "aa", "x"))
+      print("string.gsub()", string.gsub("aaaa", "aa", ""))
+      print("string.gsub()", string.gsub("a,b,,c", ",", 7))
+      print("string.gsub()", string.gsub("abcabc", "b", "xy", 0))
+      print("string.gsub()", string.gsub("abcabc", "b", "xy", -1))
+      print("string.gsub()", string.gsub("abcabc", "abc", "x", 1))
+      print("string.gsub()", string.gsub("abc", "abcd", "x"))
+      print("string.gsub()", string.gsub("", "a", "x"))
+      local r, c = string.gsub("a\0b\0", "\0", "<\0>")
+      print("string.gsub()", r == "a<\0>b<\0>", c)
+      print("string.gsub()", pcall(string.gsub, "a)b", ")", "x"))
+      print("string.gsub()", pcall(string.gsub, "a)b", "a)", "x"))
+      local s = ("0123456789"):rep(100)
+      r, c = string.gsub(s, "789", "-")
+      print("string.gsub()", c, #r, r:sub(1, 23))
+   end
+   do -- replacement strings with escapes
+      print("string.gsub()", string.gsub("abc", "(b)", "[%1|%0|%%]"))
+      print("string.gsub()", string.gsub("abc", "b", "%%%0%%"))
+      print("string.gsub()", string.gsub("abc", "()b", "<%1>"))
+      print("string.gsub()", string.gsub("abcabc", "%w", "%0-"))
+      print("string.gsub()", string.gsub("abc", "%w", "long literal %0 text"))
+      local function E(ok, msg) return ok and "no error" or msg end
+      print("string.gsub()", E(pcall(string.gsub, "abc", "b", "x%")))
+      print("string.gsub()", E(pcall(string.gsub, "abc", "b", "%x")))
+      print("string.gsub()", E(pcall(string.gsub, "abc", "(b)", "%2")))
+      print("string.gsub()", E(pcall(string.gsub, "abc", "b", "ok %% then %")))
+   end
+   do -- Lua 5.3 semantics that differ from the Lua 5.1 matcher
+      print("string.find()", string.find("a g", "%g"))
+      print("string.gsub()", string.gsub("a g", "%G", "_"))
+      print("string.gsub()", pcall(string.gsub, "x", "x", "%a"))
+      print("string.find()", string.find("abc", "", 10))
+      print("string.find()", string.find("abc", "", 4))
+      print("string.match()", string.match("abc", "()", 10))
+      print("string.gsub()", string.gsub("abc", "%w*", "-"))
+      local t = {}
+      for w in string.gmatch("abc d", "%w*") do t[#t+1] = "[" .. w .. "]" end
+      print("string.gmatch()", table.concat(t))
+   end
    print("string.rep()", string.rep("a", 0))
    print("string.rep()", string.rep("b", 1))
    print("string.rep()", string.rep("c", 4))
@@ -691,6 +868,28 @@ print("rotate", mod.rotate(1, 1, 2, 3, 4, 5, 6))
 print("rotate", mod.rotate(-1, 1, 2, 3, 4, 5, 6))
 print("rotate", mod.rotate(4, 1, 2, 3, 4, 5, 6))
 print("rotate", mod.rotate(-4, 1, 2, 3, 4, 5, 6))
+do
+  local unpack = table.unpack or unpack
+  for _,m in ipairs{ 1, 2, 3, 5, 8, 9, 12, 100, 1000 } do
+    local t, ok = {}, true
+    for i = 1, m do t[i] = i end
+    for r = -m, m do
+      local res = { mod.rotate(r, unpack(t, 1, m)) }
+      for i = 1, m do
+        if res[i] ~= t[(i-1-r) % m + 1] then ok = false end
+      end
+    end
+    print("rotate", m, ok)
+  end
+  for _,r in ipairs{ 3, 7, -7, 10, -12 } do
+    local res = { mod.rotatefull(r) }
+    local ok = true
+    for i = 1, #res do
+      if res[i] ~= (i-1-r) % #res + 1 then ok = false end
+    end
+    print("rotate", "full stack", r, #res, ok)
+  end
+end
 
 ___''
 print("strtonum", mod.strtonum("+123"))
@@ -698,6 +897,16 @@ print("strtonum", mod.strtonum(" 123 "))
 print("strtonum", mod.strtonum("-1.23"))
 print("strtonum", mod.strtonum(" 123 abc"))
 print("strtonum", mod.strtonum("jkl"))
+print("strtonum", mod.strtonum("0x10"))
+print("strtonum", mod.strtonum(" -0XfF "))
+print("strtonum", mod.strtonum("-0"))
+print("strtonum", mod.strtonum("12345678901234"))
+print("strtonum", mod.strtonum("12345678901234567890"))
+print("strtonum", mod.strtonum("inf"))
+print("strtonum", mod.strtonum("nan"))
+print("strtonum", mod.strtonum("0x"))
+print("strtonum", mod.strtonum("- 1"))
+print("strtonum", mod.strtonum(""))
 
 ___''
 local a, b, c = mod.requiref()
@@ -741,6 +950,9 @@ print("geti/seti", mod.getseti(proxy, 1))
 print("geti/seti", rawget(proxy, 1), rawget(backend, 1))
 print("geti/seti", mod.getseti(proxy, 1))
 print("geti/seti", rawget(proxy, 1), rawget(backend, 1))
+local plain = { 5 }
+print("geti/seti", mod.getseti(plain, 1), mod.getseti(plain, 2), plain[1], plain[2])
+print("geti/seti", mod.getseti(plain, 2^40), plain[2^40])
 
 -- tests for Lua 5.1
 ___''
@@ -805,11 +1017,34 @@ print("absindex", mod.absindex("hi", true))
 ___''
 print("arith", mod.arith(2, 1))
 print("arith", mod.arith(3, 5))
+print("arith", mod.arith(-7, 2))
+print("arith", mod.arith("3", "5"))
+do
+  local mt = {}
+  for _,e in ipairs{ "add", "sub", "mul", "div", "mod", "pow", "unm" } do
+    mt["__"..e] = function() return e end
+  end
+  print("arith", mod.arith(setmetatable({}, mt), 1))
+end
 
 ___''
 print("compare", mod.compare(1, 1))
 print("compare", mod.compare(2, 1))
 print("compare", mod.compare(1, 2))
+print("compare", mod.compare(0/0, 0/0))
+print("compare", mod.compare("a", "b"))
+print("compare", mod.compare("b", "a"))
+print("compare", mod.compare("a\0b", "a\0b"))
+print("compare", mod.compare("a\0b", "a\0a"))
+do
+  local mt = {
+    __eq = function() return false end,
+    __lt = function() return true end,
+    __le = function() return false end,
+  }
+  print("compare", mod.compare(setmetatable({}, mt), setmetatable({}, mt)))
+end
+print("compare", pcall(mod.compare, 1, "2"))
 
 ___''
 print("tolstring", mod.tolstring("string"))
@@ -830,6 +1065,11 @@ print("pushstring", mod.pushstring())
 
 ___''
 print("Buffer", mod.buffer())
+print("Buffer", mod.bigbuffer("ab", 5))
+print("Buffer", mod.bigbuffer("abc", 100000) == ("abc"):rep(100000))
+print("Buffer", mod.sizedbuffer(3), mod.sizedbuffer(3, true))
+print("Buffer", mod.sizedbuffer(1000000) == ("x"):rep(1000000))
+print("Buffer", mod.sizedbuffer(1000000, true) == ("x"):rep(1000000).."y")
 
 ___''
 print("execresult", mod.exec("exit 0"))
@@ -19,6 +19,20 @@ static int test_rotate (lua_State *L) {
 }
 
 
+/* rotates with the stack filled up to the LUA_MINSTACK slots that
+ * are guaranteed for a C function, so lua_rotate must reserve what
+ * it needs itself */
+static int test_rotatefull (lua_State *L) {
+  int r = (int)luaL_checkinteger(L, 1);
+  int i;
+  lua_settop(L, 1);
+  for (i = 1; i <= LUA_MINSTACK; ++i)
+    lua_pushinteger(L, i);
+  lua_rotate(L, 2, r);
+  return LUA_MINSTACK;
+}
+
+
 static int test_str2num (lua_State *L) {
   const char *s = luaL_checkstring(L, 1);
   size_t len = lua_stringtonumber(L, s);
@@ -137,8 +151,8 @@ static int test_arith (lua_State *L) {
 }
 
 static int test_compare (lua_State *L) {
-  luaL_checknumber(L, 1);
-  luaL_checknumber(L, 2);
+  luaL_checkany(L, 1);
+  luaL_checkany(L, 2);
   lua_settop(L, 2);
   lua_pushboolean(L, lua_compare(L, 1, 2, LUA_OPEQ));
   lua_pushboolean(L, lua_compare(L, 1, 2, LUA_OPLT));
@@ -284,6 +298,36 @@ static int test_buffer (lua_State *L) {
   return 1;
 }
 
+static int test_sizedbuffer (lua_State *L) {
+  luaL_Buffer b;
+  size_t n = (size_t)luaL_checkinteger(L, 1);
+  int extra = lua_toboolean(L, 2);
+  char *p = luaL_buffinitsize(L, &b, n);
+  memset(p, 'x', n);
+  luaL_addsize(&b, n);
+  if (extra)
+    luaL_addchar(&b, 'y');
+  luaL_pushresult(&b);
+  return 1;
+}
+
+static int test_bigbuffer (lua_State *L) {
+  luaL_Buffer b;
+  lua_Integer i, n = luaL_checkinteger(L, 2);
+  size_t len = 0;
+  const char *s = luaL_checklstring(L, 1, &len);
+  luaL_buffinit(L, &b);
+  for (i = 0; i < n; ++i) {
+    if (i % 2) {
+      lua_pushvalue(L, 1);
+      luaL_addvalue(&b);
+    } else
+      luaL_addlstring(&b, s, len);
+  }
+  luaL_pushresult(&b);
+  return 1;
+}
+
 static int test_exec (lua_State *L) {
   const char *cmd = luaL_checkstring(L, 1);
   errno = 0;
@@ -321,6 +365,7 @@ static int test_loadfile (lua_State *L) {
 static const luaL_Reg funcs[] = {
   { "isinteger", test_isinteger },
   { "rotate", test_rotate },
+  { "rotatefull", test_rotatefull },
   { "strtonum", test_str2num },
   { "requiref", test_requiref },
   { "getseti", test_getseti },
@@ -340,6 +385,8 @@ static const luaL_Reg funcs[] = {
   { "tolstring", test_tolstring },
   { "pushstring", test_pushstring },
   { "buffer", test_buffer },
+  { "bigbuffer", test_bigbuffer },
+  { "sizedbuffer", test_sizedbuffer },
   { "exec", test_exec },
   { "loadstring", test_loadstring },
   { "loadfile", test_loadfile },